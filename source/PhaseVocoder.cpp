@@ -1,62 +1,66 @@
 #include "PhaseVocoder.h"
 
-PhaseVocoder::PhaseVocoder(int fftSizeIn, double sampleRateIn, int numChannelsIn)
+PhaseVocoder::PhaseVocoder(int fftSizeIn, double sampleRateIn, int numChannelsIn, bool downsampleIn)
 {
     N = fftSizeIn;
     sampleRate = sampleRateIn;
     numChannels = numChannelsIn;
-    prepare(N, sampleRate, numChannels);
+    prepare(N, sampleRate, numChannels, downsampleIn);
 }
 
-void PhaseVocoder::prepare(int fftSizeIn, double sampleRateIn, int numChannelsIn)
+int PhaseVocoder::getRateDivisor(double sampleRate, bool downsample)
 {
-    inputCircBuff.clear();
-    outputCircBuff.clear();
+    int divisor = 1;
 
+    while (downsample && divisor < maxRateDivisor && sampleRate / (2 * divisor) >= minProcessingRate)
+        divisor *= 2;
+
+    return divisor;
+}
+
+int PhaseVocoder::getFFTSizeFor(int frameLengthMs, double processingRate)
+{
+    // Nearest power of two on a log scale, e.g. 21/43/85 ms -> 1024/2048/4096 at 44.1 or 48 kHz
+    const double frameSamples = frameLengthMs * processingRate / 1000.0;
+    const int order = (int) std::round(std::log2(juce::jmax(1.0, frameSamples)));
+
+    return juce::jlimit(minFFTSize, maxFFTSize, 1 << juce::jlimit(0, 30, order));
+}
+
+void PhaseVocoder::prepare(int fftSizeIn, double sampleRateIn, int numChannelsIn, bool downsampleIn)
+{
     DBG("PV prepare() called");
 
+    jassert(fftSizeIn <= maxFFTSize);
+    jassert(numChannelsIn <= maxNumChannels);
+
     N = fftSizeIn;
     DBG("fftSize: " << N);
     sampleRate = sampleRateIn;
     numChannels = numChannelsIn;
-
-    float smoothPSR = pitchShiftRatioSmoothed.getCurrentValue();
-
-    analysisHopSize  = N / 5;
-    synthesisHopSize = int(analysisHopSize * smoothPSR);
+    rateDivisor = getRateDivisor(sampleRate, downsampleIn);
+    DBG("processing rate: " << sampleRate / rateDivisor);
 
     pitchShiftRatioSmoothed.reset(sampleRate, 0.000001f);
+    bypassMix.reset(sampleRate, bypassRampSeconds);
 
-    int minBufferSize = 2 * N;
+    // The arena is sized for the longest frame at the processing rate, so changing the FFT size
+    // (which happens on the audio thread) just re-carves it. Only a new sample rate, channel count
+    // or processing rate reallocates, to exactly what that configuration needs.
+    const int maxSize = getFFTSizeFor(maxFrameLengthMs, sampleRate / rateDivisor);
+    const size_t requiredBytes = layoutArena(juce::jmax(N, maxSize), rateDivisor, nullptr);
 
-    int fftOrder = (int) std::round(std::log2(N));
-    fft = std::make_unique<juce::dsp::FFT>(fftOrder);
-
-    // Resize arrays
-    window.resize(N);
-    centerFreqs.resize(N/2 + 1);
-
-    analysisFrame.assign(numChannels, std::vector<float>(2 * N));
-    phasePrev.assign(numChannels, std::vector<float>(N/2 + 1));
-    magPrev.assign(numChannels, std::vector<float>(N/2 + 1));
-    synthesisSpectrum.assign(numChannels, std::vector<float>(N/2 + 1));
-    synthesisPhase.assign(numChannels, std::vector<float>(N/2 + 1));
-
-    for (int ch = 0; ch < numChannels; ++ch)
+    if (requiredBytes != arenaBytes)
     {
-        std::fill(analysisFrame[ch].begin(), analysisFrame[ch].end(), 0.0f);
-        std::fill(synthesisPhase[ch].begin(), synthesisPhase[ch].end(), 0.0f);
-        std::fill(phasePrev[ch].begin(),      phasePrev[ch].end(),      0.0f);
-        std::fill(magPrev[ch].begin(),        magPrev[ch].end(),        0.0f);
+        arenaStorage.allocate(requiredBytes + arenaAlignment, false);
+        auto address = reinterpret_cast<uintptr_t>(arenaStorage.get());
+        arena = reinterpret_cast<char*>((address + arenaAlignment - 1) & ~(uintptr_t) (arenaAlignment - 1));
+        arenaBytes = requiredBytes;
     }
 
-    inputCircBuff.setSize(numChannels, minBufferSize);
-    outputCircBuff.setSize(numChannels, minBufferSize);
+    layoutArena(N, rateDivisor, arena);
 
-    inputWritePos = inputReadPos = 0;
-    outputWritePos = N;
-    outputReadPos = 0;
-    samplesAccumulated = 0;
+    fft = fftBank->get(N);
 
     // Hann window
     sumSquared = 0.0f;
@@ -67,161 +71,496 @@ void PhaseVocoder::prepare(int fftSizeIn, double sampleRateIn, int numChannelsIn
         sumSquared += win * win;
     }
 
-    normFactor = 1.0f / (sumSquared / synthesisHopSize);
-
     for (int k = 0; k <= N/2; ++k)
         centerFreqs[k] = (2.0f * pi * k) / N; // in rad/sample
+
+    // Silence is counted in host samples, and every frame also depends on the history of
+    // the resampling filters in front of it
+    const int rateFilterSamples = rateDivisor > 1 ? Resampling::getNumTaps(rateDivisor) : 0;
+
+    silentAfterSamples = N * rateDivisor + rateFilterSamples;
+    idleAfterSamples = silentAfterSamples + outputCircSize * rateDivisor + rateFilterSamples;
+
+    DBG("PV memory footprint: " << (int) getMemoryFootprintBytes() << " bytes");
+
+    reset();
+}
+
+size_t PhaseVocoder::layoutArena(int fftSize, int rateDiv, char* base)
+{
+    // Blocks are padded to the arena alignment so every channel row starts on a cache line.
+    // With base == nullptr this only measures how many bytes the layout needs.
+    const int floatsPerLine = int(arenaAlignment / sizeof(float));
+    auto padded = [floatsPerLine] (int numFloats) { return (numFloats + floatsPerLine - 1) / floatsPerLine * floatsPerLine; };
+
+    size_t offset = 0;
+    auto carve = [&] (int numFloats)
+    {
+        float* block = base != nullptr ? reinterpret_cast<float*>(base + offset) : nullptr;
+        offset += size_t(padded(numFloats)) * sizeof(float);
+        return block;
+    };
+
+    auto referTo = [&] (juce::AudioBuffer<float>& buffer, float* block, int stride)
+    {
+        if (base == nullptr)
+            return;
+
+        // prepare() can run on the audio thread, so no heap allocation here
+        float* channels[maxNumChannels];
+        for (int ch = 0; ch < numChannels; ++ch)
+            channels[ch] = block + ch * stride;
+
+        buffer.setDataToReferTo(channels, numChannels, maxChunkSize);
+    };
+
+    analysisHopSize = fftSize / 5;
+
+    // Input holds a frame plus the chunk written before it's analysed. Output holds the
+    // grains overlap-added ahead of the read head, which reach 2N past it at a ratio of 0.5.
+    inputCircSize  = fftSize + maxChunkSize;
+    outputCircSize = 2 * fftSize + analysisHopSize + maxChunkSize;
+
+    frameStride      = padded(2 * fftSize);
+    binStride        = padded(fftSize/2 + 1);
+    inputCircStride  = padded(inputCircSize);
+    outputCircStride = padded(outputCircSize);
+
+    window         = carve(fftSize);
+    centerFreqs    = carve(fftSize/2 + 1);
+    tempResampled  = carve(2 * fftSize);
+    analysisFrame  = carve(numChannels * frameStride);
+    phasePrev      = carve(numChannels * binStride);
+    synthesisPhase = carve(numChannels * binStride);
+    inputCircBuff  = carve(numChannels * inputCircStride);
+    outputCircBuff = carve(numChannels * outputCircStride);
+
+    // Latency at the processing rate (grains are centred 3N/2 after their frame's start),
+    // then in host samples with the resampling round trip
+    latencySamples = fftSize + fftSize / 2;
+
+    if (rateDiv > 1)
+    {
+        latencySamples = latencySamples * rateDiv + Resampling::getNumTaps(rateDiv) - 1;
+
+        float* decimatorCoeffs  = carve(Decimator::getNumCoeffs(rateDiv));
+        float* decimatorHistory = carve(numChannels * Decimator::getHistorySize(rateDiv));
+        float* interpCoeffs     = carve(Interpolator::getNumCoeffs(rateDiv));
+        float* interpHistory    = carve(numChannels * Interpolator::getHistorySize(rateDiv));
+
+        const int scratchStride = padded(maxChunkSize);
+        referTo(rateBuffer, carve(numChannels * scratchStride), scratchStride);
+
+        if (base != nullptr)
+        {
+            rateDecimator.setup(rateDiv, ratePassband, numChannels, decimatorCoeffs, decimatorHistory);
+            rateInterpolator.setup(rateDiv, ratePassband, numChannels, interpCoeffs, interpHistory);
+        }
+    }
+
+    // Input history for the latency-matched bypass
+    dryDelayStride = padded(latencySamples);
+    dryDelay = carve(numChannels * dryDelayStride);
+
+    const int scratchStride = padded(maxChunkSize);
+    referTo(dryBuffer, carve(numChannels * scratchStride), scratchStride);
+
+    return offset;
+}
+
+bool PhaseVocoder::isPreparedFor(int fftSizeIn, double sampleRateIn, int numChannelsIn, bool downsampleIn) const
+{
+    return fft != nullptr
+        && N == fftSizeIn
+        && sampleRate == sampleRateIn
+        && numChannels == numChannelsIn
+        && rateDivisor == getRateDivisor(sampleRateIn, downsampleIn);
+}
+
+void PhaseVocoder::reset()
+{
+    // Clears all signal state but keeps every allocation, so a host calling
+    // prepareToPlay() again with the same settings doesn't rebuild the engine.
+    resetWetPath();
+
+    juce::FloatVectorOperations::clear(dryDelay, numChannels * dryDelayStride);
+    dryDelayPos = 0;
+
+    silentSamples = 0;
+    wetPrimeSamples = 0;
+    wetResetPending = false;
+
+    pitchShiftRatioSmoothed.setCurrentAndTargetValue(pitchShiftRatioSmoothed.getTargetValue());
+
+    dry = bypassed || isIdentity();
+    bypassMix.setCurrentAndTargetValue(dry ? 1.0f : 0.0f);
+}
+
+void PhaseVocoder::resetWetPath()
+{
+    juce::FloatVectorOperations::clear(analysisFrame,  numChannels * frameStride);
+    juce::FloatVectorOperations::clear(phasePrev,      numChannels * binStride);
+    juce::FloatVectorOperations::clear(synthesisPhase, numChannels * binStride);
+    juce::FloatVectorOperations::clear(inputCircBuff,  numChannels * inputCircStride);
+    juce::FloatVectorOperations::clear(outputCircBuff, numChannels * outputCircStride);
+
+    // Each frame ends on the newest input sample and its grain is centred N samples past a
+    // write head one hop ahead of the read head, which makes the latency exactly 3N/2 samples
+    // at the processing rate whatever the pitch shift ratio.
+    inputWritePos = 0;
+    inputReadPos = inputCircSize - N + analysisHopSize;
+    outputWritePos = analysisHopSize;
+    outputReadPos = 0;
+    samplesAccumulated = 0;
+    phaseResyncPending = true;
+
+    if (rateDivisor > 1)
+    {
+        rateDecimator.reset();
+        rateInterpolator.reset();
+    }
+}
+
+void PhaseVocoder::setBypassed(bool shouldBeBypassed)
+{
+    // Applied at the start of the next chunk, together with the pitch shift ratio
+    bypassed = shouldBeBypassed;
+}
+
+bool PhaseVocoder::isIdentity() const
+{
+    // With no pitch change the output is (ideally) just the input, N samples late, and the
+    // dry delay line is exactly that
+    return currentMode == VocoderMode::PitchShift
+        && ! pitchShiftRatioSmoothed.isSmoothing()
+        && std::abs(pitchShiftRatioSmoothed.getTargetValue() - 1.0f) < unityRatioTolerance;
+}
+
+void PhaseVocoder::setDry(bool shouldBeDry)
+{
+    if (shouldBeDry == dry)
+        return;
+
+    dry = shouldBeDry;
+
+    if (dry)
+    {
+        wetPrimeSamples = 0;
+        bypassMix.setTargetValue(1.0f);
+    }
+    else if (bypassMix.isSmoothing())
+    {
+        bypassMix.setTargetValue(0.0f);
+    }
+    else
+    {
+        // The wet path stood still while fully dry, so restart it from silence and let
+        // it fill up (one latency to reach the output, one more for whole frames) before
+        // fading it back in.
+        wetResetPending = true;
+        wetPrimeSamples = 2 * latencySamples;
+    }
 }
 
 void PhaseVocoder::process(juce::AudioBuffer<float>& buffer)
 {
+    // Fixed-size chunks keep the circular buffers (and so the arena) independent of the host block size
     const int numSamples = buffer.getNumSamples();
-    const int circSize   = inputCircBuff.getNumSamples();
-    const int channels   = buffer.getNumChannels();
+
+    for (int start = 0; start < numSamples; start += maxChunkSize)
+        processChunk(buffer, start, juce::jmin(maxChunkSize, numSamples - start));
+}
+
+void PhaseVocoder::processChunk(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    const int channels = juce::jmin(buffer.getNumChannels(), numChannels);
+
+    // === SILENCE DETECTION === //
+    bool blockIsSilent = true;
+    for (int ch = 0; ch < channels && blockIsSilent; ++ch)
+        blockIsSilent = buffer.getMagnitude(ch, startSample, numSamples) < silenceThreshold;
+
+    silentSamples = blockIsSilent ? juce::jmin(silentSamples + numSamples, maxSilentSamples) : 0;
+
+    setDry(bypassed || isIdentity());
+
+    // Every frame has been silent for long enough that every buffer has drained too, so there
+    // is nothing to analyse, overlap-add or filter. All the buffers hold silence, so leaving
+    // their read/write heads where they are is the same as moving them on.
+    if (silentSamples >= idleAfterSamples + numSamples)
+    {
+        for (int ch = 0; ch < channels; ++ch)
+            buffer.clear(ch, startSample, numSamples);
+
+        bypassMix.skip(numSamples);
+
+        if (wetPrimeSamples > 0 && (wetPrimeSamples -= numSamples) <= 0)
+            bypassMix.setTargetValue(0.0f);
+
+        phaseResyncPending = true;
+        return;
+    }
 
     // float smoothPSR = pitchShiftRatioSmoothed.getCurrentValue();
 
     float smoothPSR = pitchShiftRatioSmoothed.getNextValue();
-    synthesisHopSize = int(analysisHopSize * smoothPSR);
-    normFactor = 1.0f / (sumSquared / (std::abs(synthesisHopSize - analysisHopSize) + analysisHopSize));
 
-    // Write input into circular buffer
-    for (int i = 0; i < numSamples; ++i)
+    // The dry signal is only needed while dry or fading in/out of it,
+    // and the wet one not at all once fully dry.
+    const bool needsDry = bypassMix.isSmoothing() || bypassMix.getCurrentValue() > 0.0f;
+    const bool needsWet = ! dry || bypassMix.isSmoothing();
+
+    if (wetResetPending)
     {
-        for (int ch = 0; ch < channels; ++ch)
-            inputCircBuff.setSample(ch, inputWritePos, buffer.getSample(ch, i));
+        resetWetPath();
+        wetResetPending = false;
+    }
 
-        inputWritePos = (inputWritePos + 1) % circSize;
-        samplesAccumulated++;
+    // Latency-matched input history for the dry signal, read before it's overwritten
+    for (int ch = 0; ch < channels; ++ch)
+    {
+        const float* in = buffer.getReadPointer(ch, startSample);
+        float* history = getDryDelay(ch);
+        float* dryOut = dryBuffer.getWritePointer(ch);
+        int pos = dryDelayPos;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            // The ring is exactly latencySamples long, so pos holds the oldest sample
+            if (needsDry)
+                dryOut[i] = history[pos];
+
+            history[pos] = in[i];
+            pos = (pos + 1) % latencySamples;
+        }
     }
 
-    // Do vocoder analysis/synthesis whenever enough samples accumulated
-    while (samplesAccumulated >= analysisHopSize)
+    dryDelayPos = (dryDelayPos + numSamples) % latencySamples;
+
+    // Once fully dry the wet path isn't heard, so it doesn't run at all
+    if (needsWet && rateDivisor > 1)
     {
-        // smoothPSR = pitchShiftRatioSmoothed.getNextValue();
+        // High rate sessions run the wet path at sampleRate / rateDivisor
+        const int numRateSamples = rateDecimator.getNumOutputsFor(numSamples);
 
         for (int ch = 0; ch < channels; ++ch)
-        {
-            // Load frame
-            for (int n = 0; n < N; ++n)
-            {
-                int pos = (inputReadPos + n) % circSize;
-                analysisFrame[ch][n] = inputCircBuff.getSample(ch, pos) * window[n];
-            }
+            rateDecimator.process(ch, buffer.getReadPointer(ch, startSample), rateBuffer.getWritePointer(ch), numSamples);
+
+        rateDecimator.advance(numSamples);
 
-            std::fill(analysisFrame[ch].begin() + N, analysisFrame[ch].end(), 0.0f);
+        processHops(rateBuffer, 0, numRateSamples, smoothPSR);
 
-            // 180 degree cyclic shift
-            std::rotate(analysisFrame[ch].begin(), analysisFrame[ch].begin() + N/2, analysisFrame[ch].begin() + N);
+        for (int ch = 0; ch < channels; ++ch)
+            rateInterpolator.process(ch, rateBuffer.getReadPointer(ch), buffer.getWritePointer(ch, startSample), numSamples);
+
+        rateInterpolator.advance(numSamples);
+    }
+    else if (needsWet)
+    {
+        processHops(buffer, startSample, numSamples, smoothPSR);
+    }
 
-            // FFT
-            fft->performRealOnlyForwardTransform(analysisFrame[ch].data());
+    if (needsDry)
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float dryGain = bypassMix.getNextValue();
 
-            // Process bins
-            for (int k = 0; k <= N/2; ++k)
+            for (int ch = 0; ch < channels; ++ch)
             {
-                float real = analysisFrame[ch][2*k];
-                float imag = analysisFrame[ch][2*k + 1];
-
-                float mag   = std::sqrt(real*real + imag*imag);
-                float phase = std::atan2(imag, real);
-                
-                float omega = centerFreqs[k];
-                float targetPhase = phasePrev[ch][k] + analysisHopSize * omega;
-                
-                float deviation = phase - targetPhase;
-                float deltaPhi = omega * analysisHopSize + princArg(deviation);
-                                
-                switch (currentMode)
-                {
-                    case VocoderMode::PitchShift:
-                        synthesisPhase[ch][k] = princArg(synthesisPhase[ch][k] + deltaPhi * smoothPSR);
-                        break;
+                float v = buffer.getSample(ch, startSample + i);
+                buffer.setSample(ch, startSample + i, v + dryGain * (dryBuffer.getSample(ch, i) - v));
+            }
+        }
+    }
 
-                    case VocoderMode::Robotize:
-                        synthesisPhase[ch][k] = 0.0f;
-                        break;
+    if (wetPrimeSamples > 0 && (wetPrimeSamples -= numSamples) <= 0)
+        bypassMix.setTargetValue(0.0f);
+}
 
-                    case VocoderMode::Whisperize:
-                        synthesisPhase[ch][k] = juce::Random::getSystemRandom().nextFloat() * 2 * pi;
-                        break;
+void PhaseVocoder::processHops(juce::AudioBuffer<float>& buffer, int startSample, int numSamples, float smoothPSR)
+{
+    const int channels = juce::jmin(buffer.getNumChannels(), numChannels);
 
-                    default:
-                        synthesisPhase[ch][k] = princArg(synthesisPhase[ch][k] + deltaPhi * smoothPSR);
-                        break;
-                }
-                // float instFreq = deltaPhi / analysisHopSize;
-                
-                // Comment these out for no-op
-                analysisFrame[ch][2*k] = mag * std::cos(synthesisPhase[ch][k]);
-                analysisFrame[ch][2*k + 1] = mag * std::sin(synthesisPhase[ch][k]);
-
-                magPrev[ch][k] = mag;
-                phasePrev[ch][k] = phase;
-            }
+    int synthesisHopSize = int(analysisHopSize * smoothPSR);
+    float normFactor = 1.0f / (sumSquared / (std::abs(synthesisHopSize - analysisHopSize) + analysisHopSize));
 
-            // IFFT
-            fft->performRealOnlyInverseTransform(analysisFrame[ch].data());
+    // Write input into circular buffer
+    for (int ch = 0; ch < channels; ++ch)
+    {
+        const float* in = buffer.getReadPointer(ch, startSample);
+        float* inCirc = getInputCirc(ch);
+        int writePos = inputWritePos;
 
-            // Undo cyclic shift
-            std::rotate(analysisFrame[ch].begin(), analysisFrame[ch].begin() + N/2, analysisFrame[ch].begin() + N);
+        for (int i = 0; i < numSamples; ++i)
+        {
+            inCirc[writePos] = in[i];
+            writePos = (writePos + 1) % inputCircSize;
+        }
+    }
+
+    inputWritePos = (inputWritePos + numSamples) % inputCircSize;
+    samplesAccumulated += numSamples;
 
-            juce::FloatVectorOperations::multiply (analysisFrame[ch].data(), window.data(), N);
+    // silentSamples counts host samples, as does silentAfterSamples
+    const bool framesAreSilent = silentSamples >= silentAfterSamples + numSamples * rateDivisor;
+
+    // Do vocoder analysis/synthesis whenever enough samples accumulated
+    while (samplesAccumulated >= analysisHopSize)
+    {
+        // smoothPSR = pitchShiftRatioSmoothed.getNextValue();
 
-            if (currentMode == VocoderMode::PitchShift)
+        // Frames made entirely of silence contribute nothing
+        if (framesAreSilent)
+        {
+            phaseResyncPending = true;
+        }
+        else
+        {
+            for (int ch = 0; ch < channels; ++ch)
             {
-                // Resample to match original duration
-                double outputLength = floor(N / smoothPSR);
-                if ((int)tempResampled.size() < outputLength)
-                    tempResampled.resize(outputLength);
+                float* frame = getFrame(ch);
+                const float* inCirc = getInputCirc(ch);
+                float* outCirc = getOutputCirc(ch);
 
-                for (int n = 0; n < outputLength; ++n)
+                // Load frame
+                for (int n = 0; n < N; ++n)
                 {
-                    double x = double(n) * N / outputLength;
-                    int ix = (int)std::floor(x);
-                    float dx = float(x - ix);
+                    int pos = (inputReadPos + n) % inputCircSize;
+                    frame[n] = inCirc[pos] * window[n];
+                }
 
-                    float s0 = analysisFrame[ch][ix];
-                    float s1 = analysisFrame[ch][(ix + 1) % N];
+                processFrame(ch, smoothPSR);
 
-                    tempResampled[n] = s0 + dx * (s1 - s0);
-                }
+                juce::FloatVectorOperations::multiply (frame, window, N);
 
-                // Pitch shift OLA
-                for (int n = 0; n < outputLength; ++n)
+                if (currentMode == VocoderMode::PitchShift)
                 {
-                    int pos = (outputWritePos + n) % circSize;
-                    float prev = outputCircBuff.getSample(ch, pos);
-                    outputCircBuff.setSample(ch, pos, prev + tempResampled[n] * normFactor);
+                    // Resample to match original duration
+                    int outputLength = juce::jmin(int(std::floor(N / smoothPSR)), 2 * N);
+
+                    for (int n = 0; n < outputLength; ++n)
+                    {
+                        double x = double(n) * N / outputLength;
+                        int ix = (int)std::floor(x);
+                        float dx = float(x - ix);
+
+                        float s0 = frame[ix];
+                        float s1 = frame[(ix + 1) % N];
+
+                        tempResampled[n] = s0 + dx * (s1 - s0);
+                    }
+
+                    // Pitch shift OLA, centred like a full-length grain. A grain of up to 2N (ratio
+                    // 0.5) starts up to N/2 early, so every grain is placed N/2 later than that.
+                    const int grainStart = outputWritePos + N - outputLength / 2;
+
+                    for (int n = 0; n < outputLength; ++n)
+                    {
+                        int pos = (grainStart + n) % outputCircSize;
+                        outCirc[pos] += tempResampled[n] * normFactor;
+                    }
                 }
-            }
-            else
-            {
-                // Regular OLA for other modes
-                for (int n = 0; n < N; ++n)
+                else
                 {
-                    int pos = (outputWritePos + n) % circSize;
-                    float prev = outputCircBuff.getSample(ch, pos);
-                    outputCircBuff.setSample(ch, pos, prev + analysisFrame[ch][n] * normFactor);
+                    // Regular OLA for other modes, at the same latency
+                    const int grainStart = outputWritePos + N / 2;
+
+                    for (int n = 0; n < N; ++n)
+                    {
+                        int pos = (grainStart + n) % outputCircSize;
+                        outCirc[pos] += frame[n] * normFactor;
+                    }
                 }
             }
+
+            phaseResyncPending = false;
         }
 
-        inputReadPos  = (inputReadPos  + analysisHopSize)  % circSize;
-        outputWritePos = (outputWritePos + analysisHopSize) % circSize;
+        inputReadPos  = (inputReadPos  + analysisHopSize)  % inputCircSize;
+        outputWritePos = (outputWritePos + analysisHopSize) % outputCircSize;
         samplesAccumulated -= analysisHopSize;
     }
 
     // Output ready samples
-    for (int i = 0; i < numSamples; ++i)
+    for (int ch = 0; ch < channels; ++ch)
     {
-        for (int ch = 0; ch < channels; ++ch)
+        float* out = buffer.getWritePointer(ch, startSample);
+        float* outCirc = getOutputCirc(ch);
+        int readPos = outputReadPos;
+
+        for (int i = 0; i < numSamples; ++i)
         {
-            float v = outputCircBuff.getSample(ch, outputReadPos);
-            buffer.setSample(ch, i, v);
-            outputCircBuff.setSample(ch, outputReadPos, 0.0f);
+            out[i] = outCirc[readPos];
+            outCirc[readPos] = 0.0f;
+            readPos = (readPos + 1) % outputCircSize;
         }
+    }
+
+    outputReadPos = (outputReadPos + numSamples) % outputCircSize;
+}
+
+void PhaseVocoder::processFrame(int ch, float smoothPSR)
+{
+    float* frame = getFrame(ch);
+    float* prevPhase = getPhasePrev(ch);
+    float* synthPhase = getSynthesisPhase(ch);
+
+    std::fill(frame + N, frame + 2 * N, 0.0f);
+
+    // 180 degree cyclic shift
+    std::rotate(frame, frame + N/2, frame + N);
+
+    // FFT
+    fft->performRealOnlyForwardTransform(frame);
+
+    // Process bins
+    for (int k = 0; k <= N/2; ++k)
+    {
+        float real = frame[2*k];
+        float imag = frame[2*k + 1];
+
+        float mag   = std::sqrt(real*real + imag*imag);
+        float phase = std::atan2(imag, real);
+
+        float omega = centerFreqs[k];
+        float targetPhase = prevPhase[k] + analysisHopSize * omega;
+
+        float deviation = phase - targetPhase;
+        float deltaPhi = omega * analysisHopSize + princArg(deviation);
+
+        switch (currentMode)
+        {
+            case VocoderMode::PitchShift:
+                // After skipped hops phasePrev is stale, so restart from the analysis phase
+                synthPhase[k] = phaseResyncPending ? phase
+                                                   : princArg(synthPhase[k] + deltaPhi * smoothPSR);
+                break;
+
+            case VocoderMode::Robotize:
+                synthPhase[k] = 0.0f;
+                break;
+
+            case VocoderMode::Whisperize:
+                synthPhase[k] = juce::Random::getSystemRandom().nextFloat() * 2 * pi;
+                break;
+
+            default:
+                synthPhase[k] = princArg(synthPhase[k] + deltaPhi * smoothPSR);
+                break;
+        }
+        // float instFreq = deltaPhi / analysisHopSize;
+
+        // Comment these out for no-op
+        frame[2*k] = mag * std::cos(synthPhase[k]);
+        frame[2*k + 1] = mag * std::sin(synthPhase[k]);
 
-        outputReadPos = (outputReadPos + 1) % circSize;
+        prevPhase[k] = phase;
     }
+
+    // IFFT
+    fft->performRealOnlyInverseTransform(frame);
+
+    // Undo cyclic shift
+    std::rotate(frame, frame + N/2, frame + N);
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <JuceHeader.h>
+#include "Resampling.h"
 
 enum class VocoderMode
 {
@@ -11,55 +12,165 @@ enum class VocoderMode
 class PhaseVocoder
 {
 public:
-    PhaseVocoder(int fftSizeIn, double sampleRateIn, int numChannelsIn);
-    void prepare(int fftSizeIn, double sampleRateIn, int numChannelsIn);
+    // fftSizeIn is in samples at getProcessingRate(sampleRateIn, downsampleIn)
+    PhaseVocoder(int fftSizeIn, double sampleRateIn, int numChannelsIn, bool downsampleIn);
+    void prepare(int fftSizeIn, double sampleRateIn, int numChannelsIn, bool downsampleIn);
+    bool isPreparedFor(int fftSizeIn, double sampleRateIn, int numChannelsIn, bool downsampleIn) const;
+    void reset();
     void process(juce::AudioBuffer<float>& buffer);
-    
+
+    // Soft bypass: crossfades to the input delayed by getLatencySamples(). A pitch shift
+    // ratio of 1 does the same, as there's nothing to process.
+    void setBypassed(bool shouldBeBypassed);
+    int getLatencySamples() const { return latencySamples; }
+
+    // Heap + object bytes owned by this instance (excluding the FFTs' own tables)
+    size_t getMemoryFootprintBytes() const { return sizeof(PhaseVocoder) + arenaBytes; }
+
     VocoderMode currentMode = VocoderMode::PitchShift;
     void setMode(int modeIndex) { currentMode = static_cast<VocoderMode>(modeIndex); /*DBG("Current mode: " << modeIndex);*/ }
 
-    int N = 2048; // FFT size
+    int N = 2048; // FFT size at the processing rate
     juce::SmoothedValue<float> pitchShiftRatioSmoothed = 1.0f;
 
-    std::deque<juce::AudioBuffer<float>> inputHistory;
-    const int maxHistoryBuffers = 20;  // Store last 20 buffers
-    
+    static constexpr int minFFTSize = 256;
+    static constexpr int maxFFTSize = 16384;  // the longest frame at 192 kHz
+    static constexpr int maxChunkSize = 512;  // host blocks are processed in chunks of at most this
+    static constexpr int maxNumChannels = 8;
+
+    // === SAMPLE RATE === //
+    // Frame lengths are set in milliseconds and mapped to the nearest power of two at the
+    // processing rate, so the same setting has the same time/frequency resolution at any rate.
+    // With downsampling on, rates of 88.2 kHz and up are processed at 44.1/48 kHz (or as close
+    // as maxRateDivisor allows) and the wet signal is band-limited to just below that Nyquist.
+    static constexpr int maxFrameLengthMs = 85;  // longest FFT_SIZE choice, the arena is sized for this at the processing rate
+    static constexpr int maxRateDivisor = 4;
+    static constexpr double minProcessingRate = 44100.0;
+
+    static int getRateDivisor(double sampleRate, bool downsample);
+    static double getProcessingRate(double sampleRate, bool downsample) { return sampleRate / getRateDivisor(sampleRate, downsample); }
+    static int getFFTSizeFor(int frameLengthMs, double processingRate);
+
 private:
     // === CONFIG === //
     double sampleRate = 48000.0;
-    int analysisHopSize = N / 8;
-    int synthesisHopSize;
+    int numChannels = 0;
+    int rateDivisor = 1;      // host samples per processed sample
+    int latencySamples = 0;   // in host samples
+
+    // === ARENA === //
+    // Every per-instance buffer is carved out of this one aligned block. It's sized for the
+    // longest frame at the processing rate, so changing the FFT size only re-carves it.
+    juce::HeapBlock<char> arenaStorage;
+    char* arena = nullptr;
+    size_t arenaBytes = 0;
+
+    size_t layoutArena(int fftSize, int rateDiv, char* base);
 
-    int numChannels;
-    
     // === FFT + WINDOWS === //
-    std::unique_ptr<juce::dsp::FFT> fft;
-    std::vector<float> window;
-    std::vector<std::vector<float>> analysisFrame;
-    std::vector<float> tempResampled;
-    std::vector<float> centerFreqs;
-    float normFactor;
-    float sumSquared;
-    
+    const juce::dsp::FFT* fft = nullptr;  // shared, from the FFT bank
+    float* window = nullptr;          // N
+    float* centerFreqs = nullptr;     // N/2 + 1
+    float* tempResampled = nullptr;   // 2N, enough for a ratio of 0.5
+    float* analysisFrame = nullptr;   // numChannels x 2N
+    float sumSquared = 0.0f;
+    int analysisHopSize = 0;
+
+    int frameStride = 0;
+
     // === CIRCULAR BUFFERS === //
-    juce::AudioBuffer<float> inputCircBuff;
-    juce::AudioBuffer<float> outputCircBuff;
+    float* inputCircBuff = nullptr;   // numChannels x inputCircSize
+    float* outputCircBuff = nullptr;  // numChannels x outputCircSize
 
-    int inputWritePos, 
-        inputReadPos, 
-        outputWritePos,   
-        outputReadPos, 
+    int inputCircSize = 0,
+        outputCircSize = 0,
+        inputCircStride = 0,
+        outputCircStride = 0;
+
+    int inputWritePos,
+        inputReadPos,
+        outputWritePos,
+        outputReadPos,
         samplesAccumulated = 0;
 
+    // === HIGH RATE RESAMPLING === //
+    Decimator rateDecimator;
+    Interpolator rateInterpolator;
+    juce::AudioBuffer<float> rateBuffer; // maxChunkSize scratch, in the arena
+
+    // === FFT BANK === //
+    // One FFT per size the engine can use, built once per process and shared by every instance
+    // (juce::dsp::FFT's transforms are const), so changing size never allocates.
+    struct FFTBank
+    {
+        static constexpr int minOrder = 8;   // minFFTSize
+        static constexpr int maxOrder = 14;  // maxFFTSize
+
+        FFTBank()
+        {
+            for (int order = minOrder; order <= maxOrder; ++order)
+                ffts[size_t(order - minOrder)] = std::make_unique<juce::dsp::FFT>(order);
+        }
+
+        const juce::dsp::FFT* get(int size) const
+        {
+            const int order = juce::roundToInt(std::log2(size));
+            jassert(order >= minOrder && order <= maxOrder && (1 << order) == size);
+            return ffts[size_t(order - minOrder)].get();
+        }
+
+        std::array<std::unique_ptr<juce::dsp::FFT>, maxOrder - minOrder + 1> ffts;
+    };
+
+    static_assert((1 << FFTBank::minOrder) == minFFTSize, "FFT bank must cover the smallest FFT size");
+    static_assert((1 << FFTBank::maxOrder) == maxFFTSize, "FFT bank must cover the largest FFT size");
+
+    juce::SharedResourcePointer<FFTBank> fftBank;
+
+    // === SILENCE + BYPASS === //
+    int silentSamples = 0;       // consecutive silent host samples
+    int silentAfterSamples = 0;  // silent host samples after which every frame is empty
+    int idleAfterSamples = 0;    // silent host samples after which every buffer has drained
+    bool phaseResyncPending = true;  // hops were skipped, phase history is stale
+
+    bool bypassed = false;
+    bool dry = false;          // bypassed or identity, the output is (fading to) the delayed input
+    bool wetResetPending = false;
+    int wetPrimeSamples = 0;
+    juce::SmoothedValue<float> bypassMix = 0.0f; // 0 = wet, 1 = dry
+
+    float* dryDelay = nullptr;  // numChannels x latencySamples of input history
+    int dryDelayStride = 0, dryDelayPos = 0;
+    juce::AudioBuffer<float> dryBuffer; // maxChunkSize scratch, in the arena
+
     // === PHASE ARRAYS === //
-    std::vector<std::vector<float>> phasePrev;
-    std::vector<std::vector<float>> synthesisSpectrum;
-    std::vector<std::vector<float>> magPrev;
-    std::vector<std::vector<float>> synthesisPhase;
-    
+    float* phasePrev = nullptr;       // numChannels x (N/2 + 1)
+    float* synthesisPhase = nullptr;  // numChannels x (N/2 + 1)
+
+    int binStride = 0;
+
     // === HELPERS === //
+    void resetWetPath();
+    void processChunk(juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+    void setDry(bool shouldBeDry);
+    bool isIdentity() const;
+    void processHops(juce::AudioBuffer<float>& buffer, int startSample, int numSamples, float smoothPSR);
+    void processFrame(int ch, float smoothPSR);
     float princArg(float x) {return std::fmod(x + pi, 2 * pi) - pi; }
-    
+
+    float* getFrame(int ch) const          { return analysisFrame  + ch * frameStride; }
+    float* getPhasePrev(int ch) const      { return phasePrev      + ch * binStride; }
+    float* getSynthesisPhase(int ch) const { return synthesisPhase + ch * binStride; }
+    float* getInputCirc(int ch) const      { return inputCircBuff  + ch * inputCircStride; }
+    float* getOutputCirc(int ch) const     { return outputCircBuff + ch * outputCircStride; }
+    float* getDryDelay(int ch) const       { return dryDelay       + ch * dryDelayStride; }
+
     // === CONSTANTS === //
     const float pi = juce::MathConstants<float>::pi;
+    static constexpr float silenceThreshold = 1.0e-6f;   // -120 dBFS
+    static constexpr float unityRatioTolerance = 1.0e-4f;
+    static constexpr int maxSilentSamples = 1 << 30;
+    static constexpr double bypassRampSeconds = 0.01;
+    static constexpr size_t arenaAlignment = 64;         // cache line, and enough for any SIMD width
+    static constexpr float ratePassband = 0.91f;         // of the processing Nyquist, 20 kHz at 44.1 kHz
 };
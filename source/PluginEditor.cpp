@@ -47,9 +47,9 @@ PhaseVocoderAudioProcessorEditor::PhaseVocoderAudioProcessorEditor (PhaseVocoder
     pitchShiftLabel.attachToComponent(&pitchShiftSlider, false);
     addAndMakeVisible(pitchShiftLabel);
 
-    fftSizeComboBox.addItem("1024", 1);
-    fftSizeComboBox.addItem("2048", 2);
-    fftSizeComboBox.addItem("4096", 3);
+    fftSizeComboBox.addItem("21 ms", 1);
+    fftSizeComboBox.addItem("43 ms", 2);
+    fftSizeComboBox.addItem("85 ms", 3);
     
 
     // FFT size combo box
@@ -62,10 +62,19 @@ PhaseVocoderAudioProcessorEditor::PhaseVocoderAudioProcessorEditor (PhaseVocoder
     fftSizeComboBox.setTextWhenNoChoicesAvailable("No Sizes Available!");
     addAndMakeVisible(fftSizeComboBox);
 
-    fftSizeLabel.setText("FFT Size", juce::dontSendNotification);
+    fftSizeLabel.setText("Frame", juce::dontSendNotification);
     fftSizeLabel.attachToComponent(&fftSizeComboBox, true); // Attach to the left
     addAndMakeVisible(fftSizeLabel);
 
+    // High sample rate downsampling toggle
+    downsampleAttachment = std::make_unique<juce::AudioProcessorValueTreeState::ButtonAttachment>(
+        apvts,
+        "DOWNSAMPLE",                 // Parameter ID string
+        downsampleButton              // The UI component to connect
+    );
+
+    addAndMakeVisible(downsampleButton);
+
     setSize (400, 300);
 }
 
@@ -113,6 +122,13 @@ void PhaseVocoderAudioProcessorEditor::resized()
         controlWidth, 
         comboHeight
     );
+
+    downsampleButton.setBounds(
+        margin * 2 + controlWidth, 
+        margin + 100, 
+        controlWidth, 
+        comboHeight
+    );
 }
 
 void PhaseVocoderAudioProcessorEditor::updateModeUI()
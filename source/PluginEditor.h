@@ -21,11 +21,13 @@ private:
     juce::ComboBox modeSelector;
     juce::Slider pitchShiftSlider;
     juce::ComboBox fftSizeComboBox;
+    juce::ToggleButton downsampleButton { "Downsample High Rates" };
 
     juce::Label pitchShiftLabel, fftSizeLabel, modeLabel;
 
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> pitchShiftAttachment;
     std::unique_ptr<juce::AudioProcessorValueTreeState::ComboBoxAttachment> fftSizeAttachment, modeAttachment;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ButtonAttachment> downsampleAttachment;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PhaseVocoderAudioProcessorEditor)
 };
@@ -14,10 +14,12 @@ PhaseVocoderAudioProcessor::PhaseVocoderAudioProcessor()
                        apvts(*this, &undoManager, "Parameters", createParameterLayout())
 {
     apvts.addParameterListener("FFT_SIZE", this);
+    apvts.addParameterListener("DOWNSAMPLE", this);
 }
 
 PhaseVocoderAudioProcessor::~PhaseVocoderAudioProcessor()
 {
+    cancelPendingUpdate();
 }
 
 //==============================================================================
@@ -93,16 +95,46 @@ void PhaseVocoderAudioProcessor::prepareToPlay (double sampleRateIn, int samples
 
     DBG("PP prepare called");
 
-    // Get choice indices for fftSize
-    auto* p = dynamic_cast<AudioParameterChoice*>(apvts.getParameter("FFT_SIZE"));
-    N = p->getCurrentChoiceName().getIntValue();
+    bool downsample = *apvts.getRawParameterValue("DOWNSAMPLE") >= 0.5f;
+    N = getFFTSize(downsample);
+
+    // Any state restored via setStateInformation() is already in the APVTS, so the engine is
+    // built once at its final size. Hosts often call prepareToPlay() repeatedly with the same
+    // settings; in that case the existing engine is kept and only its signal state is cleared.
+    // Anything else re-prepares it in place, which only reallocates when the processing rate or
+    // channel count changes how much memory it needs.
+    if (engine == nullptr)
+        engine = std::make_unique<PhaseVocoder>(N, sampleRate, numChannels, downsample);
+    else if (! engine->isPreparedFor(N, sampleRate, numChannels, downsample))
+        engine->prepare(N, sampleRate, numChannels, downsample);
 
-    // Rebuild the engine synchronously
-    engine = std::make_unique<PhaseVocoder>(N, sampleRate, numChannels);
+    preparedFFTSize = N;
+    preparedRateDivisor = PhaseVocoder::getRateDivisor(sampleRate, downsample);
+    engineRebuildPending = false;
+
+    // Start at the restored settings rather than gliding from the defaults
+    float pitchShiftSemitones = *apvts.getRawParameterValue("PITCH_SHIFT");
+    engine->pitchShiftRatioSmoothed.setCurrentAndTargetValue(std::pow(2.0f, pitchShiftSemitones / 12.0f));
+    engine->setMode(static_cast<int>(*apvts.getRawParameterValue("MODE")));
+    engine->setBypassed(*apvts.getRawParameterValue("BYPASS") >= 0.5f);
+    engine->reset();
 
+    // Kept in step so an update still pending from the audio thread reports the same value
+    pendingLatency = engine->getLatencySamples();
+    setLatencySamples(pendingLatency.load());
+
+    samplesPerBlock = samplesPerBlockIn;
     juce::ignoreUnused (sampleRate, samplesPerBlock);
 }
 
+int PhaseVocoderAudioProcessor::getFFTSize (bool downsample) const
+{
+    auto* p = dynamic_cast<AudioParameterChoice*>(apvts.getParameter("FFT_SIZE"));
+    const int frameLengthMs = p->getCurrentChoiceName().getIntValue();
+
+    return PhaseVocoder::getFFTSizeFor(frameLengthMs, PhaseVocoder::getProcessingRate(sampleRate, downsample));
+}
+
 void PhaseVocoderAudioProcessor::releaseResources()
 {
 }
@@ -130,6 +162,25 @@ void PhaseVocoderAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
                                               juce::MidiBuffer& midiMessages)
 {
     juce::ignoreUnused (midiMessages);
+    processBlockInternal (buffer, *apvts.getRawParameterValue("BYPASS") >= 0.5f);
+}
+
+void PhaseVocoderAudioProcessor::processBlockBypassed (juce::AudioBuffer<float>& buffer,
+                                                      juce::MidiBuffer& midiMessages)
+{
+    // Only called by hosts that bypass without going through getBypassParameter(),
+    // still needs to be latency-compensated
+    juce::ignoreUnused (midiMessages);
+    processBlockInternal (buffer, true);
+}
+
+juce::AudioProcessorParameter* PhaseVocoderAudioProcessor::getBypassParameter() const
+{
+    return apvts.getParameter("BYPASS");
+}
+
+void PhaseVocoderAudioProcessor::processBlockInternal (juce::AudioBuffer<float>& buffer, bool bypassed)
+{
     juce::ScopedNoDenormals noDenormals;
 
     if (engine == nullptr)
@@ -146,13 +197,52 @@ void PhaseVocoderAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
     // Update vocoder mode
     int modeIndex = static_cast<int>(*apvts.getRawParameterValue("MODE"));
     engine->setMode(modeIndex);
+    engine->setBypassed(bypassed);
 
-    if (fftResizePending.exchange(false))
-        engine->prepare(newFFTSize, sampleRate, numChannels);
+    if (engineRebuildPending.exchange(false))
+    {
+        // The size is stored after the downsampling setting, so if that still gives the prepared
+        // processing rate, the size is for it. If not, handleAsyncUpdate() rebuilds instead.
+        const int size = newFFTSize.load();
+        const bool downsample = newDownsample.load();
+
+        if (PhaseVocoder::getRateDivisor(sampleRate, downsample) == preparedRateDivisor.load())
+        {
+            engine->prepare(size, sampleRate, numChannels, downsample);
+            preparedFFTSize = size;
+
+            pendingLatency = engine->getLatencySamples();
+            triggerAsyncUpdate();
+        }
+    }
     
     engine->process(buffer);
 }
 
+void PhaseVocoderAudioProcessor::handleAsyncUpdate()
+{
+    const bool downsample = newDownsample.load();
+    const int rateDivisor = PhaseVocoder::getRateDivisor(sampleRate, downsample);
+
+    if (preparedFFTSize.load() != 0 && rateDivisor != preparedRateDivisor.load())
+    {
+        // Reallocates the arena, so the audio thread mustn't be inside processBlock()
+        const bool wasSuspended = isSuspended();
+        suspendProcessing(true);
+
+        const int size = getFFTSize(downsample);
+        engine->prepare(size, sampleRate, numChannels, downsample);
+        preparedFFTSize = size;
+        preparedRateDivisor = rateDivisor;
+        engineRebuildPending = false;
+        pendingLatency = engine->getLatencySamples();
+
+        suspendProcessing(wasSuspended);
+    }
+
+    setLatencySamples(pendingLatency.load());
+}
+
 //==============================================================================
 bool PhaseVocoderAudioProcessor::hasEditor() const
 {
@@ -178,8 +268,8 @@ juce::AudioProcessorValueTreeState::ParameterLayout PhaseVocoderAudioProcessor::
 
     params.push_back(std::make_unique<juce::AudioParameterChoice>(
         ParameterID {"FFT_SIZE", 1},  // param ID
-        "FFT Size", // param name
-        StringArray {"1024", "2048", "4096"}, // choices
+        "Frame Length", // param name
+        StringArray {"21 ms", "43 ms", "85 ms"}, // choices, 1024/2048/4096 at 48 kHz
         1 // default choice
     ));
 
@@ -190,6 +280,18 @@ juce::AudioProcessorValueTreeState::ParameterLayout PhaseVocoderAudioProcessor::
     0                  // default index
     ));
 
+    params.push_back(std::make_unique<juce::AudioParameterBool>(
+        ParameterID {"DOWNSAMPLE", 1},  // parameter ID
+        "Downsample High Rates",  // parameter name
+        false              // default value
+    ));
+
+    params.push_back(std::make_unique<juce::AudioParameterBool>(
+        ParameterID {"BYPASS", 1},  // parameter ID
+        "Bypass",          // parameter name
+        false              // default value
+    ));
+
 
     return { params.begin(), params.end() };
 }
@@ -197,12 +299,17 @@ juce::AudioProcessorValueTreeState::ParameterLayout PhaseVocoderAudioProcessor::
 //==============================================================================
 void PhaseVocoderAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    juce::ignoreUnused (destData);
+    auto state = apvts.copyState();
+    std::unique_ptr<juce::XmlElement> xml (state.createXml());
+    copyXmlToBinary (*xml, destData);
 }
 
 void PhaseVocoderAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    juce::ignoreUnused (data, sizeInBytes);
+    std::unique_ptr<juce::XmlElement> xmlState (getXmlFromBinary (data, sizeInBytes));
+
+    if (xmlState != nullptr && xmlState->hasTagName (apvts.state.getType()))
+        apvts.replaceState (juce::ValueTree::fromXml (*xmlState));
 }
 
 //==============================================================================
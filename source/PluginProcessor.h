@@ -29,7 +29,8 @@ private:
 
 //==============================================================================
 class PhaseVocoderAudioProcessor final : public juce::AudioProcessor,
-                                         public juce::AudioProcessorValueTreeState::Listener
+                                         public juce::AudioProcessorValueTreeState::Listener,
+                                         private juce::AsyncUpdater
 {
 public:
     //==============================================================================
@@ -43,7 +44,11 @@ public:
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
 
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlockBypassed (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
     using AudioProcessor::processBlock;
+    using AudioProcessor::processBlockBypassed;
+
+    juce::AudioProcessorParameter* getBypassParameter() const override;
 
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
@@ -74,18 +79,34 @@ public:
     static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
     juce::AudioProcessorValueTreeState apvts {*this, &undoManager, "Parameters", createParameterLayout()};
 
-    std::atomic<bool> fftResizePending { false };
-    int newFFTSize;
+    std::atomic<bool> engineRebuildPending { false };
+    std::atomic<int> newFFTSize { 0 };
+    std::atomic<bool> newDownsample { false };
+    std::atomic<int> preparedFFTSize { 0 }; // 0 until prepareToPlay() has built the engine
+    std::atomic<int> preparedRateDivisor { 1 };
 
     void parameterChanged(const String& parameterID, float newValue) override
     {
-        if (parameterID == "FFT_SIZE")
+        if (parameterID == "FFT_SIZE" || parameterID == "DOWNSAMPLE")
         {
-            fftResizePending = true;
-
-            auto* p = dynamic_cast<AudioParameterChoice*>(apvts.getParameter("FFT_SIZE"));
-            newFFTSize = p->getCurrentChoiceName().getIntValue();
-            DBG("Parameter " << parameterID << " changed to " << newFFTSize);
+            // A restored session sets these before the first prepareToPlay(), which builds the
+            // engine that way anyway - only a live engine set up differently needs rebuilding.
+            const int prepared = preparedFFTSize.load();
+            if (prepared == 0)
+                return;
+
+            newDownsample = *apvts.getRawParameterValue("DOWNSAMPLE") >= 0.5f;
+            newFFTSize = getFFTSize(newDownsample.load());
+
+            // A new processing rate changes the size of the engine's arena, which is reallocated
+            // on the message thread. A new FFT size only re-carves it, so that's applied on the
+            // audio thread. Below 88.2 kHz the downsampling toggle changes neither.
+            if (PhaseVocoder::getRateDivisor(sampleRate, newDownsample.load()) != preparedRateDivisor.load())
+                triggerAsyncUpdate();
+            else
+                engineRebuildPending = newFFTSize.load() != prepared;
+
+            DBG("Parameter " << parameterID << " changed to " << newValue);
         }
     }
 
@@ -93,7 +114,17 @@ public:
     std::unique_ptr<PhaseVocoder> engine;
 
 private:
-    double sampleRate;
+    void processBlockInternal (juce::AudioBuffer<float>& buffer, bool bypassed);
+
+    // Re-prepares the engine when downsampling is toggled, and reports latency changes made
+    // on the audio thread (setLatencySamples() isn't real-time safe)
+    void handleAsyncUpdate() override;
+    std::atomic<int> pendingLatency { 0 };
+
+    // FFT_SIZE is a frame length in ms, this is its size in samples at the engine's processing rate
+    int getFFTSize (bool downsample) const;
+
+    std::atomic<double> sampleRate { 44100.0 }; // getFFTSize() also reads it from parameterChanged()
     int samplesPerBlock;
     int numChannels;
     int N;
@@ -0,0 +1,174 @@
+#include "Resampling.h"
+
+// Zeroth-order modified Bessel function of the first kind, for the Kaiser window
+static double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+
+    for (int k = 1; term > 1.0e-12 * sum; ++k)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+double Resampling::windowedSinc(int j, int numTaps, double cutoffCyclesPerSample)
+{
+    const double pi = juce::MathConstants<double>::pi;
+    const double t = j - 0.5 * (numTaps - 1);
+
+    double sinc = t == 0.0 ? 2.0 * cutoffCyclesPerSample
+                           : std::sin(2.0 * pi * cutoffCyclesPerSample * t) / (pi * t);
+
+    double r = 2.0 * j / (numTaps - 1) - 1.0;
+    return sinc * besselI0(kaiserBeta * std::sqrt(juce::jmax(0.0, 1.0 - r * r))) / besselI0(kaiserBeta);
+}
+
+void Resampling::designLowpass(float* coeffs, int numTaps, double cutoffCyclesPerSample)
+{
+    double sum = 0.0;
+
+    for (int j = 0; j < numTaps; ++j)
+        sum += windowedSinc(j, numTaps, cutoffCyclesPerSample);
+
+    for (int j = 0; j < numTaps; ++j)
+        coeffs[j] = float(windowedSinc(j, numTaps, cutoffCyclesPerSample) / sum);
+}
+
+//==============================================================================
+void Decimator::setup(int factorIn, float passband, int numChannelsIn, float* coeffMemory, float* historyMemory)
+{
+    factor = factorIn;
+    numTaps = Resampling::getNumTaps(factor);
+    numChannels = numChannelsIn;
+    coeffs = coeffMemory;
+    history = historyMemory;
+
+    Resampling::designLowpass(coeffs, numTaps, Resampling::getCutoffCycles(factor, passband));
+    reset();
+}
+
+void Decimator::reset()
+{
+    juce::FloatVectorOperations::clear(history, numChannels * getHistorySize(factor));
+    historyPos = 0;
+    phase = 0;
+}
+
+int Decimator::process(int ch, const float* in, float* out, int numSamples) const
+{
+    float* hist = history + ch * getHistorySize(factor);
+    int pos = historyPos;
+    int ph = phase;
+    int numOut = 0;
+
+    for (int i = 0; i < numSamples; ++i)
+    {
+        // hist[pos + 1 .. pos + numTaps] always holds the last numTaps inputs, oldest first
+        pos = (pos + 1) % numTaps;
+        hist[pos] = hist[pos + numTaps] = in[i];
+
+        if (ph == 0)
+        {
+            // The windowed sinc is symmetric, so it doesn't need reversing
+            const float* x = hist + pos + 1;
+            float acc = 0.0f;
+
+            for (int j = 0; j < numTaps; ++j)
+                acc += coeffs[j] * x[j];
+
+            out[numOut++] = acc;
+        }
+
+        ph = (ph + 1) % factor;
+    }
+
+    return numOut;
+}
+
+void Decimator::advance(int numSamples)
+{
+    historyPos = (historyPos + numSamples) % numTaps;
+    phase = (phase + numSamples) % factor;
+}
+
+//==============================================================================
+void Interpolator::setup(int factorIn, float passband, int numChannelsIn, float* coeffMemory, float* historyMemory)
+{
+    factor = factorIn;
+    phaseTaps = getTapsPerPhase(factor);
+    numChannels = numChannelsIn;
+    coeffs = coeffMemory;
+    history = historyMemory;
+
+    // Split the prototype into one branch per phase, scaled by the factor to make up for
+    // the zero-stuffing. Branches are stored reversed so process() can run forwards.
+    const int numTaps = Resampling::getNumTaps(factor);
+    const double cutoffCycles = Resampling::getCutoffCycles(factor, passband);
+
+    double sum = 0.0;
+    for (int j = 0; j < numTaps; ++j)
+        sum += Resampling::windowedSinc(j, numTaps, cutoffCycles);
+
+    for (int p = 0; p < factor; ++p)
+    {
+        float* branch = coeffs + p * phaseTaps;
+
+        for (int k = 0; k < phaseTaps; ++k)
+        {
+            int j = p + k * factor;
+            branch[phaseTaps - 1 - k] = j < numTaps ? float(Resampling::windowedSinc(j, numTaps, cutoffCycles) * factor / sum)
+                                                    : 0.0f;
+        }
+    }
+
+    reset();
+}
+
+void Interpolator::reset()
+{
+    juce::FloatVectorOperations::clear(history, numChannels * getHistorySize(factor));
+    historyPos = 0;
+    phase = 0;
+}
+
+void Interpolator::process(int ch, const float* in, float* out, int numSamples) const
+{
+    float* hist = history + ch * getHistorySize(factor);
+    int pos = historyPos;
+    int ph = phase;
+    int numIn = 0;
+
+    for (int i = 0; i < numSamples; ++i)
+    {
+        // hist[pos + 1 .. pos + phaseTaps] holds the last phaseTaps low-rate inputs, oldest first
+        if (ph == 0)
+        {
+            pos = (pos + 1) % phaseTaps;
+            hist[pos] = hist[pos + phaseTaps] = in[numIn++];
+        }
+
+        const float* branch = coeffs + ph * phaseTaps;
+        const float* x = hist + pos + 1;
+        float acc = 0.0f;
+
+        for (int k = 0; k < phaseTaps; ++k)
+            acc += branch[k] * x[k];
+
+        out[i] = acc;
+        ph = (ph + 1) % factor;
+    }
+}
+
+void Interpolator::advance(int numSamples)
+{
+    for (int i = 0; i < numSamples; ++i)
+    {
+        if (phase == 0)
+            historyPos = (historyPos + 1) % phaseTaps;
+
+        phase = (phase + 1) % factor;
+    }
+}
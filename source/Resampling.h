@@ -0,0 +1,79 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Windowed-sinc FIR decimation/interpolation by an integer factor, in polyphase form so only
+// the outputs that are kept (or the taps that land on non-zero inputs) are ever computed.
+//
+// Neither class allocates: the owner carves getNumCoeffs() floats plus getHistorySize()
+// floats per channel out of its own memory and hands them over in setup(). Both filters have
+// the same odd length, so a decimate -> interpolate round trip delays by getNumTaps() - 1.
+//
+// Channels are processed one at a time from the same starting state, then advance() moves
+// that state on by the number of full-rate samples just processed.
+
+namespace Resampling
+{
+    // With a passband edge at 0.91 of the decimated Nyquist and the stopband starting at it,
+    // this length and window give over 80 dB of stopband rejection
+    static constexpr int tapsPerPhase = 128;
+    static constexpr double kaiserBeta = 8.6;
+
+    inline int getNumTaps(int factor) { return tapsPerPhase * factor + 1; }
+
+    // Sinc cutoff in cycles per full-rate sample, halfway between the passband edge (relative to
+    // the decimated Nyquist frequency) and that Nyquist
+    inline double getCutoffCycles(int factor, float passband) { return 0.25 * (passband + 1.0) / factor; }
+
+    // Kaiser-windowed sinc lowpass: one (unnormalised) tap, or a whole filter with unity DC gain
+    double windowedSinc(int j, int numTaps, double cutoffCyclesPerSample);
+    void designLowpass(float* coeffs, int numTaps, double cutoffCyclesPerSample);
+}
+
+class Decimator
+{
+public:
+    static int getNumCoeffs(int factor)   { return Resampling::getNumTaps(factor); }
+    static int getHistorySize(int factor) { return 2 * Resampling::getNumTaps(factor); } // doubled, so reads are contiguous
+
+    // passband is relative to the decimated Nyquist frequency, where the stopband starts
+    void setup(int factorIn, float passband, int numChannelsIn, float* coeffMemory, float* historyMemory);
+    void reset();
+
+    // Filters numSamples full-rate inputs and writes an output for each one that lands on
+    // phase 0 of the decimation cycle. Returns the number of outputs written.
+    int process(int ch, const float* in, float* out, int numSamples) const;
+    void advance(int numSamples);
+
+    // Number of outputs the next numSamples inputs will produce
+    int getNumOutputsFor(int numSamples) const { return (phase + numSamples + factor - 1) / factor - (phase + factor - 1) / factor; }
+
+private:
+    int factor = 1, numTaps = 1, numChannels = 0;
+    float* coeffs = nullptr;
+    float* history = nullptr;
+    int historyPos = 0, phase = 0;
+};
+
+class Interpolator
+{
+public:
+    static int getNumCoeffs(int factor)   { return factor * getTapsPerPhase(factor); }
+    static int getHistorySize(int factor) { return 2 * getTapsPerPhase(factor); }
+
+    // passband is relative to the decimated Nyquist frequency, where the stopband starts
+    void setup(int factorIn, float passband, int numChannelsIn, float* coeffMemory, float* historyMemory);
+    void reset();
+
+    // Writes numSamples full-rate outputs, taking the next low-rate input from `in`
+    // whenever the interpolation cycle is at phase 0.
+    void process(int ch, const float* in, float* out, int numSamples) const;
+    void advance(int numSamples);
+
+private:
+    static int getTapsPerPhase(int factor) { return (Resampling::getNumTaps(factor) + factor - 1) / factor; }
+
+    int factor = 1, phaseTaps = 1, numChannels = 0;
+    float* coeffs = nullptr;  // one reversed branch of phaseTaps per phase
+    float* history = nullptr;
+    int historyPos = 0, phase = 0;
+};